@@ -0,0 +1,119 @@
+#include "mbed.h"
+#include "C12832.h"
+#include "QEI.h"
+#include "TimerEncoder.h"
+
+// Compares the CPU time left to the main loop with no encoder, with QEI
+// (one InterruptIn per A/B edge) and with TimerEncoder (hardware counting)
+// while the motors run at full duty. The encoder must be wired to PB_4/PB_5
+// so both decoders see the same signal. TimerEncoder runs first: ~QEI does not
+// mask the EXTI lines, so they would keep firing under the timer's window,
+// whereas QEI's InterruptIn puts the pins back to GPIO input afterwards.
+
+#define PULSES_PER_REV 624
+#define BENCH_WINDOW_US 2000000
+#define BENCH_SPINUP_S 2.0f
+
+C12832 lcd(D11, D13, D12, D7, D10);
+
+DigitalOut enable(PC_3);
+PwmOut PWM1(PA_15);     // left
+DigitalOut bipo1(PA_13);
+DigitalOut d1(PA_14);
+
+PwmOut PWM2(PB_7);      // right
+DigitalOut bipo2(PC_11);
+DigitalOut d2(PC_10);
+
+struct BenchResult {
+    uint32_t loops;
+    int pulses;
+};
+
+// Spins for a fixed window and counts how many iterations the main loop gets;
+// every encoder interrupt taken during the window shows up as lost iterations.
+template <typename Encoder>
+BenchResult runWindow(Encoder *encoder)
+{
+    BenchResult result;
+    volatile uint32_t loops = 0;
+    Timer t;
+
+    if (encoder) encoder->reset();
+    t.start();
+    while (t.read_us() < BENCH_WINDOW_US) {
+        loops++;
+    }
+    result.loops = loops;
+    result.pulses = encoder ? encoder->getPulses() : 0;
+    return result;
+}
+
+void report(const char *name, BenchResult r, uint32_t baseline)
+{
+    float edgesPerSec = abs(r.pulses) / (BENCH_WINDOW_US / 1000000.0f);
+    float loadPercent = 100.0f * (1.0f - (float)r.loops / (float)baseline);
+    printf("%-13s loops: %10lu  edges/s: %8.0f  irq load: %5.1f%%\r\n",
+           name, (unsigned long)r.loops, edgesPerSec, loadPercent);
+}
+
+void fullSpeed()
+{
+    bipo1.write(0);     // unipolar
+    bipo2.write(0);
+    d1.write(0);        // forward direction
+    d2.write(0);
+
+    PWM1.period(0.003f);
+    PWM1.write(1.0f);
+    PWM2.period(0.003f);
+    PWM2.write(1.0f);
+    enable.write(1);
+}
+
+void stopMotors()
+{
+    enable.write(0);
+    PWM1.write(0.0f);
+    PWM2.write(0.0f);
+}
+
+int main()
+{
+    lcd.cls();
+    lcd.locate(0, 0);
+    lcd.printf("Encoder IRQ benchmark");
+
+    fullSpeed();
+    wait(BENCH_SPINUP_S);
+
+    BenchResult idle = runWindow<QEI>(NULL);
+
+    BenchResult hard;
+    {
+        TimerEncoder hw(TIM3, PB_4, PB_5, PULSES_PER_REV, TimerEncoder::X4_ENCODING);
+        hard = runWindow(&hw);
+    }
+
+    QEI qei(PB_4, PB_5, NC, PULSES_PER_REV, QEI::X4_ENCODING);
+    BenchResult soft = runWindow(&qei);
+
+    stopMotors();
+
+    printf("\r\nX4 decoding, %d PPR, motors at full duty\r\n", PULSES_PER_REV);
+    report("no encoder", idle, idle.loops);
+    report("QEI", soft, idle.loops);
+    report("TimerEncoder", hard, idle.loops);
+
+    lcd.cls();
+    lcd.locate(0, 0);
+    lcd.printf("QEI load: %.1f%%", 100.0f * (1.0f - (float)soft.loops / idle.loops));
+    lcd.locate(0, 10);
+    lcd.printf("TIM load: %.1f%%", 100.0f * (1.0f - (float)hard.loops / idle.loops));
+    lcd.locate(0, 20);
+    lcd.printf("Edges/s: %.0f", abs(hard.pulses) / (BENCH_WINDOW_US / 1000000.0f));
+
+    while (1) {
+        wait(1.0);
+    }
+}
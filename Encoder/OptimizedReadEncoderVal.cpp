@@ -1,6 +1,7 @@
 #include "mbed.h"
 #include "C12832.h"
 #include "QEI.h"
+#include "TimerEncoder.h"
 
 // Configuration constants
 #define VDD 3.3f
@@ -64,7 +65,10 @@ DigitalOut direction2(PA_14);
 
 // Encoders
 QEI leftEncoder(PB_3, PA_10, NC, PULSES_PER_REV, QEI::X2_ENCODING);
-QEI rightEncoder(PB_5, PB_4, NC, PULSES_PER_REV, QEI::X2_ENCODING);
+// PB_4/PB_5 are TIM3 CH1/CH2, so the right wheel is counted in hardware.
+// A/B are swapped relative to the old QEI(PB_5, PB_4) to put A on CH1, and
+// reverse restores the sign QEI gave.
+TimerEncoder rightEncoder(TIM3, PB_4, PB_5, PULSES_PER_REV, TimerEncoder::X2_ENCODING, true);
 
 void updateDisplay(float leftPot, float rightPot, int leftCount, int rightCount) {
     lcd.cls();
@@ -0,0 +1,182 @@
+#ifndef TIMER_ENCODER_H
+#define TIMER_ENCODER_H
+
+#include "mbed.h"
+
+// Drop-in replacement for QEI that counts quadrature edges in an STM32 timer
+// running in encoder mode instead of raising an InterruptIn on every A/B edge.
+// The only interrupt left is a compare event on CH3/CH4, armed SYNC_WINDOW
+// counts either side of the last read, which extends the 16-bit hardware
+// counter to 32 bits by accumulating the signed 16-bit difference between reads.
+// Nothing is inferred from where the counter wrapped, so a wheel resting on the
+// 0/0xFFFF boundary cannot skew the count. The handler may be delayed by up to
+// another SYNC_WINDOW counts (0.5 s at 30k edges/s) before the difference
+// becomes ambiguous.
+//
+// Channel A must be wired to CH1 and channel B to CH2 of the chosen timer.
+// On the Nucleo-F401RE, with the LCD shield and motor PWM pins in use, TIM3 on
+// PB_4 (CH1) / PB_5 (CH2) is the free pair. TIM5 is taken by the us_ticker.
+//
+// No index channel: the buggy encoders are always wired with NC, so
+// getRevolutions() is derived from the pulse count instead.
+
+class TimerEncoder {
+public:
+    typedef enum Encoding {
+        X2_ENCODING,    // count both edges of channel A (timer TI1 mode)
+        X4_ENCODING     // count both edges of channel A and B (timer TI12 mode)
+    } Encoding;
+
+    TimerEncoder(TIM_TypeDef *timer, PinName channelA, PinName channelB,
+                 int pulsesPerRev, Encoding encoding = X2_ENCODING, bool reverse = false)
+        : timer_(timer), handle_(), slot_(slotFor(timer)),
+          pulsesPerRev_(pulsesPerRev), encoding_(encoding), total_(0), last_(0)
+    {
+        if (slot_ < 0) {
+            error("TimerEncoder: timer has no encoder mode support\r\n");
+        }
+        instances_[slot_] = this;
+
+        uint32_t af = enableTimerClock(timer);
+        pin_function(channelA, STM_PIN_DATA(STM_MODE_AF_PP, GPIO_PULLUP, af));
+        pin_function(channelB, STM_PIN_DATA(STM_MODE_AF_PP, GPIO_PULLUP, af));
+
+        handle_.Instance = timer;
+        handle_.Init.Prescaler = 0;
+        handle_.Init.CounterMode = TIM_COUNTERMODE_UP;
+        handle_.Init.Period = 0xFFFF;
+        handle_.Init.ClockDivision = TIM_CLOCKDIVISION_DIV1;
+        handle_.Init.RepetitionCounter = 0;
+
+        TIM_Encoder_InitTypeDef config;
+        config.EncoderMode = (encoding == X4_ENCODING) ? TIM_ENCODERMODE_TI12 : TIM_ENCODERMODE_TI1;
+        // Inverting TI1 reverses the counting direction
+        config.IC1Polarity = reverse ? TIM_ICPOLARITY_FALLING : TIM_ICPOLARITY_RISING;
+        config.IC1Selection = TIM_ICSELECTION_DIRECTTI;
+        config.IC1Prescaler = TIM_ICPSC_DIV1;
+        config.IC1Filter = 0x3;     // 8 samples at fCK_INT, rejects motor noise spikes
+        config.IC2Polarity = TIM_ICPOLARITY_RISING;
+        config.IC2Selection = TIM_ICSELECTION_DIRECTTI;
+        config.IC2Prescaler = TIM_ICPSC_DIV1;
+        config.IC2Filter = 0x3;
+        HAL_TIM_Encoder_Init(&handle_, &config);
+        reset();
+
+        // CH3/CH4 stay in frozen output compare mode, only their match flags
+        // are used.
+        IRQn_Type irq = irqFor(timer);
+        NVIC_SetVector(irq, (uint32_t)handlers_[slot_]);
+        NVIC_EnableIRQ(irq);
+        timer_->DIER |= TIM_DIER_CC3IE | TIM_DIER_CC4IE;
+
+        HAL_TIM_Encoder_Start(&handle_, TIM_CHANNEL_ALL);
+    }
+
+    ~TimerEncoder()
+    {
+        IRQn_Type irq = irqFor(timer_);
+        HAL_TIM_Encoder_Stop(&handle_, TIM_CHANNEL_ALL);
+        timer_->DIER &= ~(TIM_DIER_CC3IE | TIM_DIER_CC4IE);
+        NVIC_DisableIRQ(irq);
+        NVIC_ClearPendingIRQ(irq);
+        instances_[slot_] = NULL;
+    }
+
+    void reset(void)
+    {
+        core_util_critical_section_enter();
+        sync();
+        total_ = 0;
+        core_util_critical_section_exit();
+    }
+
+    int getPulses(void)
+    {
+        core_util_critical_section_enter();
+        sync();
+        int32_t total = total_;
+        core_util_critical_section_exit();
+        return (int)total;
+    }
+
+    int getRevolutions(void)
+    {
+        int countsPerRev = pulsesPerRev_ * ((encoding_ == X4_ENCODING) ? 4 : 2);
+        return getPulses() / countsPerRev;
+    }
+
+private:
+    // Travel in either direction that triggers a resync, a quarter of the
+    // 16-bit range so the next sync is still well inside +/-32767.
+    static const uint16_t SYNC_WINDOW = 0x4000;
+
+    TIM_TypeDef *timer_;
+    TIM_HandleTypeDef handle_;
+    int slot_;
+    int pulsesPerRev_;
+    Encoding encoding_;
+    volatile int32_t total_;    // extended count since the last reset()
+    volatile uint16_t last_;    // CNT at the last sync
+
+    // Non-copyable: the ISR slot points at exactly one instance.
+    TimerEncoder(const TimerEncoder &);
+    TimerEncoder &operator=(const TimerEncoder &);
+
+    // Folds the travel since the last sync into total_ and re-arms the compare
+    // window around the new position. Called from the ISR or with interrupts off.
+    void sync(void)
+    {
+        uint16_t count = (uint16_t)timer_->CNT;
+        total_ += (int16_t)(uint16_t)(count - last_);
+        last_ = count;
+        timer_->CCR3 = (uint16_t)(count + SYNC_WINDOW);
+        timer_->CCR4 = (uint16_t)(count - SYNC_WINDOW);
+        timer_->SR = ~(TIM_SR_CC3IF | TIM_SR_CC4IF);
+    }
+
+    static int slotFor(TIM_TypeDef *timer)
+    {
+        if (timer == TIM1) return 0;
+        if (timer == TIM2) return 1;
+        if (timer == TIM3) return 2;
+        if (timer == TIM4) return 3;
+        return -1;
+    }
+
+    static IRQn_Type irqFor(TIM_TypeDef *timer)
+    {
+        if (timer == TIM1) return TIM1_CC_IRQn;
+        if (timer == TIM2) return TIM2_IRQn;
+        if (timer == TIM3) return TIM3_IRQn;
+        return TIM4_IRQn;
+    }
+
+    // Enables the timer's peripheral clock and returns the GPIO alternate
+    // function that routes its channels to the pins.
+    static uint32_t enableTimerClock(TIM_TypeDef *timer)
+    {
+        if (timer == TIM1) { __HAL_RCC_TIM1_CLK_ENABLE(); return GPIO_AF1_TIM1; }
+        if (timer == TIM2) { __HAL_RCC_TIM2_CLK_ENABLE(); return GPIO_AF1_TIM2; }
+        if (timer == TIM3) { __HAL_RCC_TIM3_CLK_ENABLE(); return GPIO_AF2_TIM3; }
+        __HAL_RCC_TIM4_CLK_ENABLE();
+        return GPIO_AF2_TIM4;
+    }
+
+    static void tim1Compare(void) { instances_[0]->sync(); }
+    static void tim2Compare(void) { instances_[1]->sync(); }
+    static void tim3Compare(void) { instances_[2]->sync(); }
+    static void tim4Compare(void) { instances_[3]->sync(); }
+
+    static TimerEncoder *instances_[4];
+    static void (* const handlers_[4])(void);
+};
+
+// Header-only so each standalone program can include it; every program is a
+// single translation unit, so defining the statics here is safe.
+TimerEncoder *TimerEncoder::instances_[4] = { NULL, NULL, NULL, NULL };
+void (* const TimerEncoder::handlers_[4])(void) = {
+    &TimerEncoder::tim1Compare, &TimerEncoder::tim2Compare,
+    &TimerEncoder::tim3Compare, &TimerEncoder::tim4Compare
+};
+
+#endif
@@ -0,0 +1,487 @@
+#include "mbed.h"
+#include "C12832.h"
+#include "QEI.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Live tuning over the USB serial port (115200 8N1). Type "help" for commands.
+// Characters are queued by the RX interrupt and parsed from main(), so the
+// console never runs inside or blocks the control tick. "set" only stages a
+// value; the control tick applies everything staged at its next run.
+
+#define SERIAL_BAUD 115200
+#define RX_BUFFER_SIZE 128      // must be a power of two
+#define LINE_LENGTH 48
+#define LCD_UPDATE_MS 200
+
+// Tunables, defaults taken from the square path and encoder programs
+float fspeed = 0.6f;
+float turnspeed = 0.5f;
+float uturnspeed = 0.9f;
+float forwardTime = 0.8f;
+float turnTime = 0.22f;
+float uturnTime = 0.8f;
+float benchTime = 2.0f;
+float samplingFrequency = 10.0f;
+float pulsesPerRev = 624.0f;
+float pwmPeriod = 0.003f;
+
+struct Tunable {
+    const char *name;
+    float *live;                // only ever written by the control tick
+    float min, max;
+    volatile float pending;
+    volatile bool dirty;
+};
+
+Tunable tunables[] = {
+    { "fspeed",      &fspeed,            0.0f,     1.0f,  0, false },
+    { "turnspeed",   &turnspeed,         0.0f,     1.0f,  0, false },
+    { "uturnspeed",  &uturnspeed,        0.0f,     1.0f,  0, false },
+    { "forward_t",   &forwardTime,       0.0f,     10.0f, 0, false },
+    { "turn_t",      &turnTime,          0.0f,     10.0f, 0, false },
+    { "uturn_t",     &uturnTime,         0.0f,     10.0f, 0, false },
+    { "bench_t",     &benchTime,         0.1f,     30.0f, 0, false },
+    { "fs",          &samplingFrequency, 1.0f,     1000.0f, 0, false },
+    { "ppr",         &pulsesPerRev,      1.0f,     4096.0f, 0, false },
+    { "pwm_period",  &pwmPeriod,         0.00003f, 0.02f, 0, false },
+};
+const int NUM_TUNABLES = sizeof(tunables) / sizeof(tunables[0]);
+
+// Hardware resources
+C12832 lcd(D11, D13, D12, D7, D10);
+RawSerial pc(USBTX, USBRX);
+
+QEI leftWheel(PC_4, PB_1, NC, 624, QEI::X4_ENCODING);
+QEI rightWheel(PC_2, PC_5, NC, 624, QEI::X4_ENCODING);
+
+DigitalOut enable(PC_3);
+PwmOut PWM1(PA_15);     // left
+DigitalOut bipo1(PA_13);
+DigitalOut d1(PA_14);
+
+PwmOut PWM2(PB_7);      // right
+DigitalOut bipo2(PC_11);
+DigitalOut d2(PC_10);
+
+Ticker controlTicker;
+Timeout stepTimeout;
+Timer tickTimer;
+
+// Single producer (RX interrupt) / single consumer (main) ring buffer,
+// no locking needed as each index is only written by one side.
+class RxBuffer {
+private:
+    volatile uint32_t head, tail;
+    char data[RX_BUFFER_SIZE];
+
+public:
+    RxBuffer() : head(0), tail(0) {}
+
+    void push(char c) {
+        uint32_t next = (head + 1) & (RX_BUFFER_SIZE - 1);
+        if (next != tail) {     // drop the character if full
+            data[head] = c;
+            head = next;
+        }
+    }
+
+    bool pop(char *c) {
+        if (tail == head) return false;
+        *c = data[tail];
+        tail = (tail + 1) & (RX_BUFFER_SIZE - 1);
+        return true;
+    }
+};
+
+RxBuffer rxBuffer;
+
+void onSerialRx() {
+    while (pc.readable()) {
+        rxBuffer.push(pc.getc());
+    }
+}
+
+// Manoeuvres are step tables started by the control tick and walked by a
+// Timeout armed with each step's exact duration, instead of blocking with wait().
+enum Action { STOP, FORWARD, LEFT, RIGHT, UTURN };
+
+struct Step {
+    Action action;
+    const float *duration;
+};
+
+const Step SQUARE[] = {
+    { FORWARD, &forwardTime }, { LEFT, &turnTime },
+    { FORWARD, &forwardTime }, { LEFT, &turnTime },
+    { FORWARD, &forwardTime }, { LEFT, &turnTime },
+    { FORWARD, &forwardTime }, { LEFT, &turnTime },
+    { UTURN, &uturnTime },
+    { FORWARD, &forwardTime }, { RIGHT, &turnTime },
+    { FORWARD, &forwardTime }, { RIGHT, &turnTime },
+    { FORWARD, &forwardTime }, { RIGHT, &turnTime },
+    { FORWARD, &forwardTime }, { RIGHT, &turnTime },
+};
+const Step FORWARD_ONLY[] = { { FORWARD, &forwardTime } };
+const Step LEFT_ONLY[] = { { LEFT, &turnTime } };
+const Step RIGHT_ONLY[] = { { RIGHT, &turnTime } };
+const Step UTURN_ONLY[] = { { UTURN, &uturnTime } };
+const Step BENCH[] = { { FORWARD, &benchTime } };
+
+struct Manoeuvre {
+    const char *name;
+    const Step *steps;
+    int length;
+};
+
+#define MANOEUVRE(name, steps) { name, steps, sizeof(steps) / sizeof(steps[0]) }
+const Manoeuvre manoeuvres[] = {
+    MANOEUVRE("square", SQUARE),
+    MANOEUVRE("forward", FORWARD_ONLY),
+    MANOEUVRE("left", LEFT_ONLY),
+    MANOEUVRE("right", RIGHT_ONLY),
+    MANOEUVRE("uturn", UTURN_ONLY),
+};
+const int NUM_MANOEUVRES = sizeof(manoeuvres) / sizeof(manoeuvres[0]);
+const Manoeuvre benchManoeuvre = MANOEUVRE("bench", BENCH);
+
+// Handover from main to the control tick
+const Manoeuvre * volatile requestedManoeuvre = NULL;
+volatile bool stopRequested = false;
+
+// Owned by the control tick and step Timeout (same interrupt, never concurrent)
+const Manoeuvre *activeManoeuvre = NULL;
+int activeStep = 0;
+Action currentAction = STOP;
+uint32_t lastSampleUs = 0;
+
+// Measurements published by the control tick
+volatile float leftRPM = 0.0f, rightRPM = 0.0f;
+volatile int leftTotal = 0, rightTotal = 0;
+volatile float benchSeconds = 0.0f;
+volatile uint32_t tickCount = 0, tickMaxUs = 0, tickSumUs = 0;
+volatile bool benchRunning = false, benchDone = false;
+
+void drive(Action action) {
+    currentAction = action;
+    switch (action) {
+    case FORWARD:
+        d1.write(0);        // forward direction
+        d2.write(0);
+        PWM1.write(fspeed);
+        PWM2.write(fspeed);
+        break;
+    case LEFT:
+        d1.write(0);
+        d2.write(1);
+        PWM1.write(0.0f);
+        PWM2.write(turnspeed);
+        break;
+    case RIGHT:
+        d1.write(1);
+        d2.write(0);
+        PWM1.write(0.0f);
+        PWM2.write(turnspeed);
+        break;
+    case UTURN:
+        d1.write(0);
+        d2.write(1);
+        PWM1.write(uturnspeed);
+        PWM2.write(uturnspeed);
+        break;
+    default:
+        PWM1.write(0.0f);
+        PWM2.write(0.0f);
+        break;
+    }
+    enable.write(action != STOP);
+}
+
+void controlTick();
+void nextStep();
+
+// Copies every staged value into its live variable in one go. Runs at the
+// start of the tick, so the rest of the tick only ever sees a consistent set.
+void applyPending() {
+    float oldPeriod = pwmPeriod;
+    float oldFrequency = samplingFrequency;
+    bool changed = false;
+
+    for (int i = 0; i < NUM_TUNABLES; i++) {
+        if (tunables[i].dirty) {
+            *tunables[i].live = tunables[i].pending;
+            tunables[i].dirty = false;
+            changed = true;
+        }
+    }
+    if (!changed) return;
+
+    if (pwmPeriod != oldPeriod) {
+        PWM1.period(pwmPeriod);
+        PWM2.period(pwmPeriod);
+    }
+    if (samplingFrequency != oldFrequency) {
+        // Re-attach from the tick itself so the very next tick already runs
+        // at the new rate; Ticker::attach is safe from interrupt context.
+        controlTicker.attach(&controlTick, 1.0f / samplingFrequency);
+    }
+    drive(currentAction);           // pick up new speeds mid-manoeuvre
+}
+
+// Reads and clears both encoders. If a bench is running, the pulses and time
+// since the previous read are credited to it, so calling this right at a bench
+// start or end makes the totals cover exactly the driven window.
+void sampleEncoders(int *leftPulses, int *rightPulses, float *seconds) {
+    uint32_t now = tickTimer.read_us();
+    *seconds = (now - lastSampleUs) / 1000000.0f;
+    lastSampleUs = now;
+
+    *leftPulses = leftWheel.getPulses();
+    *rightPulses = rightWheel.getPulses();
+    leftWheel.reset();
+    rightWheel.reset();
+
+    if (benchRunning) {
+        benchSeconds += *seconds;
+        leftTotal += *leftPulses;
+        rightTotal += *rightPulses;
+    }
+}
+
+void endManoeuvre() {
+    int leftPulses, rightPulses;
+    float seconds;
+
+    stepTimeout.detach();
+    sampleEncoders(&leftPulses, &rightPulses, &seconds);
+    activeManoeuvre = NULL;
+    drive(STOP);
+    if (benchRunning) {
+        benchRunning = false;
+        benchDone = true;
+    }
+}
+
+void startStep() {
+    const Step *step = &activeManoeuvre->steps[activeStep];
+    drive(step->action);
+    stepTimeout.attach(&nextStep, *step->duration);
+}
+
+void nextStep() {
+    if (++activeStep < activeManoeuvre->length) {
+        startStep();
+    } else {
+        endManoeuvre();
+    }
+}
+
+void startManoeuvre(const Manoeuvre *manoeuvre) {
+    int leftPulses, rightPulses;
+    float seconds;
+
+    // Flush the interval before the start so it is not credited to a new bench
+    sampleEncoders(&leftPulses, &rightPulses, &seconds);
+    benchRunning = (manoeuvre == &benchManoeuvre);
+    if (benchRunning) {
+        leftTotal = rightTotal = 0;
+        benchSeconds = 0.0f;
+        tickCount = tickMaxUs = tickSumUs = 0;
+    }
+    activeManoeuvre = manoeuvre;
+    activeStep = 0;
+    startStep();
+}
+
+void controlTick() {
+    uint32_t start = tickTimer.read_us();
+    int leftPulses, rightPulses;
+    float seconds;
+
+    // Measure the interval that just ended before anything changes state
+    sampleEncoders(&leftPulses, &rightPulses, &seconds);
+    if (seconds > 0) {
+        leftRPM = (leftPulses / pulsesPerRev) * (60.0f / seconds);
+        rightRPM = (rightPulses / pulsesPerRev) * (60.0f / seconds);
+    }
+
+    applyPending();
+
+    if (stopRequested) {
+        stopRequested = false;
+        benchRunning = false;
+        endManoeuvre();
+    }
+    if (requestedManoeuvre) {
+        const Manoeuvre *manoeuvre = requestedManoeuvre;
+        requestedManoeuvre = NULL;
+        startManoeuvre(manoeuvre);
+    }
+
+    if (benchRunning) {
+        uint32_t elapsed = tickTimer.read_us() - start;
+        tickCount++;
+        tickSumUs += elapsed;
+        if (elapsed > tickMaxUs) tickMaxUs = elapsed;
+    }
+}
+
+Tunable *findTunable(const char *name) {
+    for (int i = 0; i < NUM_TUNABLES; i++) {
+        if (strcmp(tunables[i].name, name) == 0) return &tunables[i];
+    }
+    return NULL;
+}
+
+void printTunable(const Tunable *t) {
+    pc.printf("%-11s = %g", t->name, *t->live);
+    if (t->dirty) pc.printf("  (pending %g)", t->pending);
+    pc.printf("\r\n");
+}
+
+void printHelp() {
+    pc.printf("list                  show all tunables\r\n");
+    pc.printf("get <name>            show one tunable\r\n");
+    pc.printf("set <name> <value>    stage a value, applied at the next control tick\r\n");
+    pc.printf("run <manoeuvre>       square | forward | left | right | uturn\r\n");
+    pc.printf("bench                 drive forward for bench_t and report encoder/tick stats\r\n");
+    pc.printf("stop                  abort the current manoeuvre\r\n");
+}
+
+void handleCommand(char *line) {
+    char *cmd = strtok(line, " \t");
+    char *arg1 = strtok(NULL, " \t");
+    char *arg2 = strtok(NULL, " \t");
+
+    if (!cmd) return;
+
+    if (strcmp(cmd, "help") == 0) {
+        printHelp();
+    } else if (strcmp(cmd, "list") == 0) {
+        for (int i = 0; i < NUM_TUNABLES; i++) printTunable(&tunables[i]);
+    } else if (strcmp(cmd, "get") == 0 && arg1) {
+        Tunable *t = findTunable(arg1);
+        if (t) printTunable(t);
+        else pc.printf("unknown tunable '%s'\r\n", arg1);
+    } else if (strcmp(cmd, "set") == 0 && arg1 && arg2) {
+        Tunable *t = findTunable(arg1);
+        char *end;
+        float value = strtof(arg2, &end);
+        if (!t) {
+            pc.printf("unknown tunable '%s'\r\n", arg1);
+        } else if (*end != '\0' || !(value >= t->min && value <= t->max)) {
+            pc.printf("%s must be a number in [%g, %g]\r\n", t->name, t->min, t->max);
+        } else {
+            core_util_critical_section_enter();
+            t->pending = value;
+            t->dirty = true;
+            core_util_critical_section_exit();
+            pc.printf("ok\r\n");
+        }
+    } else if (strcmp(cmd, "run") == 0 && arg1) {
+        for (int i = 0; i < NUM_MANOEUVRES; i++) {
+            if (strcmp(manoeuvres[i].name, arg1) == 0) {
+                requestedManoeuvre = &manoeuvres[i];
+                pc.printf("ok\r\n");
+                return;
+            }
+        }
+        pc.printf("unknown manoeuvre '%s'\r\n", arg1);
+    } else if (strcmp(cmd, "bench") == 0) {
+        requestedManoeuvre = &benchManoeuvre;
+        pc.printf("bench started\r\n");
+    } else if (strcmp(cmd, "stop") == 0) {
+        stopRequested = true;
+        pc.printf("ok\r\n");
+    } else {
+        pc.printf("bad command, try 'help'\r\n");
+    }
+}
+
+// Drains whatever the RX interrupt has queued and runs any completed lines.
+// Returns straight away when there is nothing to do.
+void pollConsole() {
+    static char line[LINE_LENGTH];
+    static int length = 0;
+    char c;
+
+    while (rxBuffer.pop(&c)) {
+        if (c == '\r' || c == '\n') {
+            if (length == 0) continue;
+            pc.printf("\r\n");
+            line[length] = '\0';
+            length = 0;
+            handleCommand(line);
+            pc.printf("> ");
+        } else if ((c == '\b' || c == 0x7F) && length > 0) {
+            length--;
+            pc.printf("\b \b");
+        } else if (c >= ' ' && length < LINE_LENGTH - 1) {
+            line[length++] = c;
+            pc.putc(c);     // echo
+        }
+    }
+}
+
+void reportBench() {
+    float seconds = benchSeconds;
+    pc.printf("\r\nbench: %.2f s at fspeed %.2f, pwm_period %g, fs %g\r\n",
+              seconds, fspeed, pwmPeriod, samplingFrequency);
+    pc.printf("  pulses  L %d  R %d  (L-R %d)\r\n", leftTotal, rightTotal, leftTotal - rightTotal);
+    if (seconds > 0) {
+        pc.printf("  avg RPM L %.1f  R %.1f\r\n",
+                  (leftTotal / pulsesPerRev) * 60.0f / seconds,
+                  (rightTotal / pulsesPerRev) * 60.0f / seconds);
+    }
+    if (tickCount > 0) {
+        pc.printf("  control tick  avg %lu us  max %lu us\r\n",
+                  (unsigned long)(tickSumUs / tickCount), (unsigned long)tickMaxUs);
+    }
+    pc.printf("> ");
+}
+
+void updateDisplay() {
+    lcd.cls();
+    lcd.locate(0, 0);
+    lcd.printf("F:%.2f T:%.2f fs:%.0f", fspeed, turnspeed, samplingFrequency);
+    lcd.locate(0, 10);
+    lcd.printf("L RPM: %.1f", leftRPM);
+    lcd.locate(0, 20);
+    lcd.printf("R RPM: %.1f", rightRPM);
+}
+
+int main() {
+    enable.write(0);
+    bipo1.write(0);     // unipolar
+    bipo2.write(0);
+    PWM1.period(pwmPeriod);
+    PWM2.period(pwmPeriod);
+    drive(STOP);
+
+    leftWheel.reset();
+    rightWheel.reset();
+
+    pc.baud(SERIAL_BAUD);
+    pc.attach(&onSerialRx, Serial::RxIrq);
+
+    tickTimer.start();
+    controlTicker.attach(&controlTick, 1.0f / samplingFrequency);
+
+    Timer lcdTimer;
+    lcdTimer.start();
+
+    pc.printf("\r\nTD1 tuning console, type 'help'\r\n> ");
+
+    while (1) {
+        pollConsole();
+
+        if (benchDone) {
+            benchDone = false;
+            reportBench();
+        }
+        if (lcdTimer.read_ms() >= LCD_UPDATE_MS) {
+            lcdTimer.reset();
+            updateDisplay();
+        }
+    }
+}